@@ -0,0 +1,32 @@
+Loop, LOAD Count
+SKIPCOND 800
+JMP Done
+CALL AddXProc
+LOAD Count
+SUB One
+STORE Count
+JMP Loop
+Done, LOAD Z
+OUTPUT
+HALT
+AddXProc, PROC
+LOAD Z
+ADD X
+STORE Z
+RET
+AddXProc, ENDP
+UnusedProc, PROC
+LOAD Y
+OUTPUT
+RET
+UnusedProc, ENDP
+X, DEC 11
+Y, DEC 7
+Z, DEC 0
+Count, DEC 6
+One, DEC 1
+Unused, DEC 99
+END
+
+// Program adds X to Z Count times through a procedure, 6 * 11 == 66 ('B')
+// UnusedProc, Y, Unused and the PROC / ENDP words are dropped by compact()
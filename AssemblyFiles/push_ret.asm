@@ -0,0 +1,16 @@
+LOAD Target
+PUSH
+RET
+LOAD Y
+OUTPUT
+HALT
+Print, LOAD X
+OUTPUT
+HALT
+X, DEC 65
+Y, DEC 66
+Target, DEC 6
+END
+
+// RET jumps to the address pushed from Target (Print), so this prints 'A'
+// compact() can't see that jump and leaves the program unchanged
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <fstream>
@@ -16,6 +17,15 @@ namespace Assembler {
     uint16_t code_length;   // number of instructions assembled
     uint16_t start_address; // where program begins
 
+    // what each word of machine code was assembled from
+    enum WordKind : uint8_t {
+        WORD_NONE,          // nothing assembled here
+        WORD_INSTR,         // an instruction (op_code + operand)
+        WORD_DATA,          // a DEC value
+        WORD_PLACEHOLDER    // PROC / ENDP, assembled as 0 (UNKNOWN CMD if run)
+    };
+    WordKind word_kind[CODE_SIZE];
+
     // model for registers
     struct mCPU {
         int AC{};
@@ -35,6 +45,7 @@ namespace Assembler {
         }
         for (size_t i{}; i < CODE_SIZE; ++i) {
             machine_code[i] = 0;
+            word_kind[i] = WORD_NONE;
         }
 //        for (size_t i{}; i < STACK; ++i) {
 //            stack[i] = 0;
@@ -170,6 +181,7 @@ namespace Assembler {
 
                     // load data value into address location in machine code
                     machine_code[address] = this_value;
+                    word_kind[address] = WORD_DATA;
                 }
 //                if (token_one.at(1) == "HEX")
 //                {
@@ -315,11 +327,394 @@ namespace Assembler {
                 machine_code[address] |= symbol_table.at(symbol);
             }
 
+            // remember what this word is for the analysis pass
+            // DEC words were already marked in pass 1
+            // a labelled PROC / ENDP splits into "Label," and "PROC"
+            bool is_proc_marker{op_code == "PROC" || op_code == "ENDP" ||
+                                (!op_code.empty() && op_code.back() == ',' && (symbol == "PROC" || symbol == "ENDP"))};
+            if (word_kind[address] != WORD_DATA) {
+                if (is_proc_marker)
+                    word_kind[address] = WORD_PLACEHOLDER;
+                else
+                    word_kind[address] = WORD_INSTR;
+            }
+
             address += 1;
             code_length += 1;
         }
     }
 
+    // ANALYSIS
+    // static pass over the assembled program, run between assemble() and
+    // load_code_into_memory()
+
+#define NO_ADDRESS 0xFFFF
+
+    // results of analyze()
+    bool reachable[CODE_SIZE];      // word can be executed starting from address 0
+    bool referenced[CODE_SIZE];     // word is read or written by reachable code
+    bool indirect_access;           // reachable code uses LOADI / STOREI
+    bool stack_access;              // reachable code uses PUSH, so RET can go anywhere
+    bool executes_data;             // control flow reaches a DEC word that decodes as an instruction
+
+    /**
+     * True if the word at address is an instruction that takes
+     * an address operand (IR[11-0] is a location in the program)
+     * @param address Location in machine code
+     */
+    bool has_address_operand(size_t address) {
+        if (word_kind[address] != WORD_INSTR)
+            return false;
+
+        switch (machine_code[address] & 0xF000) {
+            case INSTR_LOADX:
+            case INSTR_STOREX:
+            case INSTR_ADD:
+            case INSTR_SUB:
+            case INSTR_JUMPX:
+            case INSTR_CALL:
+            case INSTR_LOADI:
+            case INSTR_STOREI:
+            case INSTR_POP:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    /**
+     * True if the word at address is an instruction that reads or writes
+     * the location in its operand (as opposed to jumping to it)
+     * @param address Location in machine code
+     */
+    bool has_data_operand(size_t address) {
+        if (!has_address_operand(address))
+            return false;
+
+        uint16_t op_code = machine_code[address] & 0xF000;
+        return op_code != INSTR_JUMPX && op_code != INSTR_CALL;
+    }
+
+    /**
+     * Control flow edges out of the word at address, assuming the program
+     * only runs the instructions it assembled and RET only returns from CALL:\n
+     * JMP X goes to X, CALL X goes to X + 1 and later returns to the next word,
+     * SKIPCOND may skip the next word, HALT / RET / unknown words end the path.
+     * DEC and PROC / ENDP words get no successors here. The CPU would still run
+     * them, so analyze() flags reachable DEC words that decode as instructions.
+     * @param address Location in machine code
+     * @return Successor addresses, which may lie past the end of the program
+     */
+    std::vector<uint16_t> next_addresses(size_t address) {
+        std::vector<uint16_t> next;
+
+        if (word_kind[address] != WORD_INSTR)
+            return next;
+
+        uint16_t op_code = machine_code[address] & 0xF000;
+        uint16_t operand = machine_code[address] & 0x0FFF;
+
+        switch (op_code) {
+            case INSTR_JUMPX:
+                next.push_back(operand);
+                break;
+            case INSTR_CALL:
+                next.push_back(operand + 1);
+                next.push_back(address + 1);
+                break;
+            case INSTR_SKIPCOND:
+                next.push_back(address + 1);
+                next.push_back(address + 2);
+                break;
+            case INSTR_LOADX:
+            case INSTR_STOREX:
+            case INSTR_ADD:
+            case INSTR_SUB:
+            case INSTR_INPUT:
+            case INSTR_OUTPUT:
+            case INSTR_LOADI:
+            case INSTR_STOREI:
+            case INSTR_PUSH:
+            case INSTR_POP:
+                next.push_back(address + 1);
+                break;
+            default:
+                // HALT, RET, UNKNOWN CMD
+                break;
+        }
+
+        return next;
+    }
+
+    /**
+     * Control flow edges out of the word at address that stay inside the program
+     * @param address Location in machine code
+     * @return Successor addresses inside the program
+     */
+    std::vector<uint16_t> successors(size_t address) {
+        // falling off the end of the program stops the path
+        std::vector<uint16_t> inside;
+        for (uint16_t n: next_addresses(address)) {
+            if (n < code_length)
+                inside.push_back(n);
+        }
+        return inside;
+    }
+
+    /**
+     * Walk the control flow graph from address 0 to find reachable code,
+     * then mark every location that reachable code reads or writes.\n
+     * Pointers can't be followed statically, so once LOADI / STOREI shows up
+     * every DEC word is treated as referenced.\n
+     * Also flags PUSH (a pushed value can be RET to) and DEC words that
+     * control flow runs into, since neither fits the control flow graph.
+     */
+    void analyze() {
+        for (size_t i{}; i < CODE_SIZE; ++i) {
+            reachable[i] = false;
+            referenced[i] = false;
+        }
+        indirect_access = false;
+        stack_access = false;
+        executes_data = false;
+
+        if (code_length == 0)
+            return;
+
+        // depth first walk of the control flow graph
+        std::vector<uint16_t> work_list{0};
+        reachable[0] = true;
+
+        while (!work_list.empty()) {
+            uint16_t address = work_list.back();
+            work_list.pop_back();
+
+            for (uint16_t next: successors(address)) {
+                if (!reachable[next]) {
+                    reachable[next] = true;
+                    work_list.push_back(next);
+                }
+            }
+        }
+
+        for (size_t i{}; i < code_length; ++i) {
+            if (!reachable[i])
+                continue;
+
+            if (word_kind[i] == WORD_INSTR && (machine_code[i] & 0xF000) == INSTR_PUSH)
+                stack_access = true;
+
+            // DEC values below 0x1000 decode as UNKNOWN CMD and just stop
+            if (word_kind[i] == WORD_DATA && (machine_code[i] & 0xF000) != 0)
+                executes_data = true;
+        }
+
+        // data referenced by reachable code
+        for (size_t i{}; i < code_length; ++i) {
+            if (!reachable[i] || !has_data_operand(i))
+                continue;
+
+            uint16_t op_code = machine_code[i] & 0xF000;
+            uint16_t operand = machine_code[i] & 0x0FFF;
+
+            if (op_code == INSTR_LOADI || op_code == INSTR_STOREI)
+                indirect_access = true;
+
+            // absolute addresses outside the program are left alone
+            if (operand < code_length)
+                referenced[operand] = true;
+        }
+
+        if (indirect_access) {
+            for (size_t i{}; i < code_length; ++i) {
+                if (word_kind[i] == WORD_DATA)
+                    referenced[i] = true;
+            }
+        }
+    }
+
+    /**
+     * Rewrite machine_code as a compacted, relocated image\n
+     * Dead words (unreachable code, unreferenced data, PROC / ENDP) are dropped.
+     * Reachable code is cut into blocks of words that have to stay next to each
+     * other (fall through, CALL return, both SKIPCOND targets) and the blocks are
+     * laid out depth first from address 0 so a jump's target follows it where possible.
+     * A block that runs off the end of the program goes last, followed by zero
+     * words so it still stops with UNKNOWN CMD.
+     * Referenced data goes after the code in its original order.
+     * Operands are then relocated to the new addresses.\n
+     * NOTE: only programs without LOADI / STOREI or PUSH are compacted; anything
+     * else (string.asm, stack.asm) is left unchanged. Pointers and pushed return
+     * addresses can hold absolute addresses built at run time, which can't be
+     * relocated statically. The same goes for programs that run into a DEC word
+     * which decodes as an instruction. Self-modifying code is not supported.
+     */
+    void compact() {
+        analyze();
+
+        if (code_length == 0)
+            return;
+
+        if (indirect_access) {
+            std::cout << "Compacting Program: skipped, uses LOADI / STOREI." << std::endl;
+            return;
+        }
+        if (stack_access) {
+            std::cout << "Compacting Program: skipped, uses PUSH." << std::endl;
+            return;
+        }
+        if (executes_data) {
+            std::cout << "Compacting Program: skipped, runs into DEC data." << std::endl;
+            return;
+        }
+
+        // word i and word i + 1 must stay adjacent
+        bool glued[CODE_SIZE]{};
+        for (size_t i{}; i + 1 < code_length; ++i) {
+            if (!reachable[i] || word_kind[i] != WORD_INSTR)
+                continue;
+
+            std::vector<uint16_t> next{successors(i)};
+            for (uint16_t n: next) {
+                if (n == i + 1)
+                    glued[i] = true;
+            }
+
+            // skipping over the next word needs the one after it in place too
+            if ((machine_code[i] & 0xF000) == INSTR_SKIPCOND && i + 2 < code_length)
+                glued[i + 1] = true;
+        }
+
+        // how many words past the end the last block can fall or skip into
+        uint16_t run_off{};
+        for (size_t i{}; i < code_length; ++i) {
+            if (!reachable[i])
+                continue;
+
+            for (uint16_t n: next_addresses(i)) {
+                if ((n == i + 1 || n == i + 2) && n >= code_length)
+                    run_off = std::max<uint16_t>(run_off, n - code_length + 1);
+            }
+        }
+
+        // basic blocks: runs of glued reachable words
+        std::vector<std::pair<uint16_t, uint16_t>> blocks;  // first, last
+        uint16_t block_of[CODE_SIZE];
+        for (size_t i{}; i < code_length; ++i) {
+            if (!reachable[i])
+                continue;
+
+            if (i > 0 && glued[i - 1]) {
+                blocks.back().second = i;
+            } else {
+                blocks.emplace_back(i, i);
+            }
+            block_of[i] = blocks.size() - 1;
+        }
+
+        // lay out the blocks depth first, starting with the entry block
+        std::vector<bool> placed(blocks.size(), false);
+        std::vector<uint16_t> block_order;
+        std::vector<uint16_t> work_list{block_of[0]};
+
+        while (!work_list.empty()) {
+            uint16_t block = work_list.back();
+            work_list.pop_back();
+
+            if (placed[block])
+                continue;
+            placed[block] = true;
+            block_order.push_back(block);
+
+            // last exit pushed is placed next, so a closing JMP lands on its target
+            for (uint16_t i = blocks[block].first; i <= blocks[block].second; ++i) {
+                for (uint16_t n: successors(i)) {
+                    if (block_of[n] != block)
+                        work_list.push_back(block_of[n]);
+                }
+            }
+        }
+
+        // the block running off the end goes last (it can only be the entry
+        // block if it is the whole program, in which case it is already last)
+        if (run_off > 0) {
+            uint16_t last_block = block_of[code_length - 1];
+            block_order.erase(std::find(block_order.begin(), block_order.end(), last_block));
+            block_order.push_back(last_block);
+        }
+
+        // old address of each word in the new image, NO_ADDRESS for padding
+        std::vector<uint16_t> layout;
+        for (uint16_t block: block_order) {
+            for (uint16_t i = blocks[block].first; i <= blocks[block].second; ++i)
+                layout.push_back(i);
+        }
+        for (uint16_t i{}; i < run_off; ++i)
+            layout.push_back(NO_ADDRESS);
+
+        // referenced data that isn't also code
+        for (size_t i{}; i < code_length; ++i) {
+            if (referenced[i] && !reachable[i])
+                layout.push_back(i);
+        }
+
+        if (layout.size() >= code_length) {
+            std::cout << "Compacting Program: nothing to remove." << std::endl;
+            return;
+        }
+
+        uint16_t new_address[CODE_SIZE];
+        for (size_t i{}; i < CODE_SIZE; ++i) {
+            new_address[i] = NO_ADDRESS;
+        }
+        for (size_t i{}; i < layout.size(); ++i) {
+            if (layout[i] != NO_ADDRESS)
+                new_address[layout[i]] = i;
+        }
+
+        // build the relocated image
+        uint16_t image[CODE_SIZE]{};
+        WordKind image_kind[CODE_SIZE]{};
+        uint16_t dead{code_length};
+
+        for (size_t i{}; i < layout.size(); ++i) {
+            uint16_t old_address = layout[i];
+            if (old_address == NO_ADDRESS)
+                continue;   // zero padding, decodes as UNKNOWN CMD
+
+            image[i] = machine_code[old_address];
+            image_kind[i] = word_kind[old_address];
+            dead -= 1;
+
+            // only code that actually runs has its operand rewritten
+            if (!reachable[old_address] || !has_address_operand(old_address))
+                continue;
+
+            // CALL X enters at X + 1, so point at the word before the new entry
+            uint16_t op_code = machine_code[old_address] & 0xF000;
+            uint16_t operand = machine_code[old_address] & 0x0FFF;
+            uint16_t target = op_code == INSTR_CALL ? operand + 1 : operand;
+
+            // addresses outside the program keep their absolute value
+            if (target >= code_length || new_address[target] == NO_ADDRESS)
+                continue;
+
+            if (op_code == INSTR_CALL)
+                image[i] = op_code | (new_address[target] - 1);
+            else
+                image[i] = op_code | new_address[target];
+        }
+
+        std::cout << "Compacting Program: " << std::dec << code_length << " -> " << layout.size()
+                  << " words (" << dead << " dead, " << blocks.size() << " blocks)." << std::endl;
+
+        for (size_t i{}; i < CODE_SIZE; ++i) {
+            machine_code[i] = image[i];
+            word_kind[i] = image_kind[i];
+        }
+        code_length = layout.size();
+    }
+
     /**
      * Copy the machine code into the memory of the mCPU\n
      * Both memory and machine code are arrays
@@ -647,10 +1042,13 @@ int main() {
 //    std::string the_asm_file{ "loop_add.asm" };
 //    std::string the_asm_file{"jump.asm"};
 //    std::string the_asm_file{"stack.asm"};
+//    std::string the_asm_file{"proc_loop.asm"};
+//    std::string the_asm_file{"push_ret.asm"};
     std::string the_asm_file{"string.asm"};
 
     Assembler::initialize();
     Assembler::assemble(the_asm_file);
+    Assembler::compact();
     Assembler::load_code_into_memory();
     Assembler::fetch_decode_execute();
 